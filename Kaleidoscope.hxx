@@ -15,9 +15,10 @@
 #define LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>
-#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
 #include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
 #include <llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h>
 #include <llvm/IR/Mangler.h>
@@ -27,20 +28,45 @@ namespace llvm {
 namespace orc {
 
 class KaleidoscopeJIT {
+    // Keeps the load info the linking layer reports for each object. It is
+    // only valid during the notification, and listeners have to wait until
+    // the object is finalized, see addModule.
+    class NotifyObjectLoadedT {
+    public:
+        NotifyObjectLoadedT(KaleidoscopeJIT &J) : J(J) {}
+
+        template <typename ObjListT, typename LoadedObjInfoListT>
+        void operator()(ObjectLinkingLayerBase::ObjSetHandleT H,
+                        const ObjListT &Objects,
+                        const LoadedObjInfoListT &Infos) const {
+            for (const auto &Info : Infos)
+                J.PendingInfos.push_back(std::unique_ptr<RuntimeDyld::LoadedObjectInfo>(
+                        static_cast<RuntimeDyld::LoadedObjectInfo *>(
+                                Info->clone().release())));
+        }
+
+    private:
+        KaleidoscopeJIT &J;
+    };
+
 public:
-    typedef ObjectLinkingLayer<> ObjLayerT;
-    typedef IRCompileLayer<ObjLayerT> CompileLayerT;
-    typedef CompileLayerT::ModuleSetHandleT ModuleHandleT;
+    typedef ObjectLinkingLayer<NotifyObjectLoadedT> ObjLayerT;
+    typedef ObjLayerT::ObjSetHandleT ModuleHandleT;
 
     KaleidoscopeJIT()
             : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
-              CompileLayer(ObjectLayer, SimpleCompiler(*TM)) {
+              Compiler(*TM), ObjectLayer(NotifyObjectLoadedT(*this)) {
+        // fastcc calls marked 'tail' are always emitted as tail calls.
+        TM->Options.GuaranteedTailCallOpt = true;
         llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
     }
 
     TargetMachine &getTargetMachine() {
         return *TM; }
 
+    void registerJITEventListener(JITEventListener &L) {
+        EventListeners.push_back(&L); }
+
     ModuleHandleT addModule(std::unique_ptr<Module> M) {
         // We need a memory manager to allocate memory and resolve symbols for this
         // new module. Create one that resolves symbols by looking back into the
@@ -52,24 +78,58 @@ public:
                     return RuntimeDyld::SymbolInfo(nullptr);
                 },
                 [](const std::string &S) { return nullptr; });
-        auto H = CompileLayer.addModuleSet(singletonSet(std::move(M)),
+
+        // Compile here instead of through an IRCompileLayer, which frees the
+        // objects as soon as they are linked. Listeners refer to them until
+        // the module is removed.
+        LoadedModule LM;
+        auto Object = Compiler(*M).takeBinary();
+        LM.Objects.push_back(std::move(Object.first));
+        LM.Buffers.push_back(std::move(Object.second));
+
+        auto H = ObjectLayer.addObjectSet(LM.Objects,
                 make_unique<SectionMemoryManager>(),
                 std::move(Resolver));
+        ObjectLayer.emitAndFinalize(H);
+
+        // Listeners may read the emitted code, so they are only told once
+        // relocations have been applied.
+        LM.Handle = H;
+        LM.Infos = std::move(PendingInfos);
+        PendingInfos.clear();
+        for (unsigned I = 0; I < LM.Objects.size(); ++I)
+            for (auto *L : EventListeners)
+                L->NotifyObjectEmitted(*LM.Objects[I], *LM.Infos[I]);
 
         ModuleHandles.push_back(H);
+        LoadedModules.push_back(std::move(LM));
         return H;
     }
 
     void removeModule(ModuleHandleT H) {
+        auto LI = std::find_if(LoadedModules.begin(), LoadedModules.end(),
+                [&](const LoadedModule &LM) { return LM.Handle == H; });
+        for (auto &Obj : LI->Objects)
+            for (auto *L : EventListeners)
+                L->NotifyFreeingObject(*Obj);
         ModuleHandles.erase(
                 std::find(ModuleHandles.begin(), ModuleHandles.end(), H));
-        CompileLayer.removeModuleSet(H);
+        ObjectLayer.removeObjectSet(H);
+        LoadedModules.erase(LI);
     }
 
     JITSymbol findSymbol(const std::string Name) {
         return findMangledSymbol(mangle(Name)); }
 
 private:
+    // The objects of a module and what the linking layer reported for them,
+    // owned until the module is removed.
+    struct LoadedModule {
+        ModuleHandleT Handle;
+        std::vector<std::unique_ptr<object::ObjectFile>> Objects;
+        std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+        std::vector<std::unique_ptr<RuntimeDyld::LoadedObjectInfo>> Infos;
+    };
 
     std::string mangle(const std::string &Name) {
         std::string MangledName;
@@ -80,18 +140,12 @@ private:
         return MangledName;
     }
 
-    template <typename T> static std::vector<T> singletonSet(T t) {
-        std::vector<T> Vec;
-        Vec.push_back(std::move(t));
-        return Vec;
-    }
-
     JITSymbol findMangledSymbol(const std::string &Name) {
         // Search modules in reverse order: from last added to first added.
         // This is the opposite of the usual search order for dlsym, but makes more
         // sense in a REPL where we want to bind to the newest available definition.
         for (auto H : make_range(ModuleHandles.rbegin(), ModuleHandles.rend()))
-            if (auto Sym = CompileLayer.findSymbolIn(H, Name, true))
+            if (auto Sym = ObjectLayer.findSymbolIn(H, Name, true))
                 return Sym;
 
         // If we can't find the symbol in the JIT, try looking in the host process.
@@ -103,9 +157,12 @@ private:
 
     std::unique_ptr<TargetMachine> TM;
     const DataLayout DL;
+    SimpleCompiler Compiler;
     ObjLayerT ObjectLayer;
-    CompileLayerT CompileLayer;
     std::vector<ModuleHandleT> ModuleHandles;
+    std::vector<JITEventListener *> EventListeners;
+    std::vector<LoadedModule> LoadedModules;
+    std::vector<std::unique_ptr<RuntimeDyld::LoadedObjectInfo>> PendingInfos;
 };
 
 } // End namespace orc.
@@ -8,3 +8,86 @@
 //
 
 #include "ast.hxx"
+
+#include <llvm/ADT/FoldingSet.h>
+#include <llvm/Support/MathExtras.h>
+
+using namespace llvm;
+
+// tag leading every profile, so different node kinds never collide.
+enum ast_tag {
+    TAG_NUMBER,
+    TAG_VAR,
+    TAG_BINARY,
+    TAG_CALL,
+    TAG_IF,
+    TAG_FOR,
+};
+
+void ast_number::profile(FoldingSetNodeID& id) const {
+    id.AddInteger(TAG_NUMBER);
+    id.AddInteger(DoubleToBits(val));
+}
+
+void ast_var::profile(FoldingSetNodeID& id) const {
+    id.AddInteger(TAG_VAR);
+    id.AddString(name);
+}
+
+void ast_binary::profile(FoldingSetNodeID& id) const {
+    id.AddInteger(TAG_BINARY);
+    id.AddInteger(op);
+    lhs->profile(id);
+    rhs->profile(id);
+}
+
+void ast_binary::collect_callees(std::set<std::string>& callees) const {
+    lhs->collect_callees(callees);
+    rhs->collect_callees(callees);
+}
+
+void ast_call::profile(FoldingSetNodeID& id) const {
+    id.AddInteger(TAG_CALL);
+    id.AddString(callee);
+    id.AddInteger(args.size());
+    for (auto& arg : args) {
+        arg->profile(id); }
+}
+
+void ast_call::collect_callees(std::set<std::string>& callees) const {
+    callees.insert(callee);
+    for (auto& arg : args) {
+        arg->collect_callees(callees); }
+}
+
+void ast_if::profile(FoldingSetNodeID& id) const {
+    id.AddInteger(TAG_IF);
+    cond_->profile(id);
+    then_->profile(id);
+    else_->profile(id);
+}
+
+void ast_if::collect_callees(std::set<std::string>& callees) const {
+    cond_->collect_callees(callees);
+    then_->collect_callees(callees);
+    else_->collect_callees(callees);
+}
+
+void ast_for::profile(FoldingSetNodeID& id) const {
+    id.AddInteger(TAG_FOR);
+    id.AddString(var_name);
+    start->profile(id);
+    end->profile(id);
+    id.AddBoolean(step != nullptr);
+    if (step) {
+        step->profile(id); }
+    body->profile(id);
+}
+
+void ast_for::collect_callees(std::set<std::string>& callees) const {
+    start->collect_callees(callees);
+    end->collect_callees(callees);
+    if (step) {
+        step->collect_callees(callees); }
+    body->collect_callees(callees);
+}
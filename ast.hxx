@@ -13,29 +13,43 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <set>
 
 #include <assert.h>
 
+#include "common.hxx"
+
 namespace llvm {
 class Value;
 class Function;
+class FoldingSetNodeID;
 }
 
 struct ast_base {
+    source_location loc;
+    ast_base() : loc(state::cur_loc) { }
     virtual ~ast_base() { }
     virtual llvm::Value *generate_code() = 0;
+    // marks the calls in tail position of this expression.
+    virtual void mark_tail() { }
+    // structural identity, equal for expressions that generate the same code.
+    virtual void profile(llvm::FoldingSetNodeID& id) const = 0;
+    // names of the functions called directly by this expression.
+    virtual void collect_callees(std::set<std::string>& callees) const { }
 };
 
 struct ast_number : public ast_base {
     double val;
     ast_number(double v) : val(v) { }
     llvm::Value *generate_code() override;
+    void profile(llvm::FoldingSetNodeID& id) const override;
 };
 
 struct ast_var : public ast_base {
     std::string name;
     ast_var(const std::string& n) : name(n) { }
     llvm::Value *generate_code() override;
+    void profile(llvm::FoldingSetNodeID& id) const override;
 };
 
 struct ast_binary : public ast_base {
@@ -44,14 +58,21 @@ struct ast_binary : public ast_base {
     ast_binary(char o, std::unique_ptr<ast_base> l, std::unique_ptr<ast_base> r)
             : op(o), lhs(std::move(l)), rhs(std::move(r)) { }
     llvm::Value *generate_code() override;
+    void profile(llvm::FoldingSetNodeID& id) const override;
+    void collect_callees(std::set<std::string>& callees) const override;
 };
 
 struct ast_call : public ast_base {
     std::string callee;
     std::vector<std::unique_ptr<ast_base>> args;
+    bool is_tail = false;
     ast_call(const std::string& c, std::vector<std::unique_ptr<ast_base>> a)
             : callee(c), args(std::move(a)) { }
     llvm::Value *generate_code() override;
+    void profile(llvm::FoldingSetNodeID& id) const override;
+    void collect_callees(std::set<std::string>& callees) const override;
+    void mark_tail() override {
+        is_tail = true; }
 };
 
 struct ast_if : public ast_base {
@@ -59,6 +80,12 @@ struct ast_if : public ast_base {
     ast_if(std::unique_ptr<ast_base> c, std::unique_ptr<ast_base> t, std::unique_ptr<ast_base> e)
             : cond_(std::move(c)), then_(std::move(t)), else_(std::move(e)) { }
     llvm::Value *generate_code() override;
+    void profile(llvm::FoldingSetNodeID& id) const override;
+    void collect_callees(std::set<std::string>& callees) const override;
+    void mark_tail() override {
+        then_->mark_tail();
+        else_->mark_tail();
+    }
 };
 
 struct ast_for : public ast_base {
@@ -70,6 +97,8 @@ struct ast_for : public ast_base {
             var_name(n), start(std::move(s)), end(std::move(e)),
             step(std::move(st)), body(std::move(b)) { }
     llvm::Value *generate_code() override;
+    void profile(llvm::FoldingSetNodeID& id) const override;
+    void collect_callees(std::set<std::string>& callees) const override;
 };
 
 struct ast_prototype {
@@ -77,8 +106,15 @@ struct ast_prototype {
     std::vector<std::string> args;
     bool is_operator;
     size_t precedence;
+    // called from C (externs and top-level expressions), everything
+    // else uses fastcc so tail calls can be guaranteed.
+    bool c_callable = false;
+    // has a Kaleidoscope body, and whether everything it reaches is one too.
+    bool defined = false;
+    bool pure = false;
+    source_location loc;
     ast_prototype(const std::string& n, std::vector<std::string> a, bool is_op = false, size_t precde = 0)
-            : name(n), args(a), is_operator(is_op), precedence(precde) { }
+            : name(n), args(a), is_operator(is_op), precedence(precde), loc(state::cur_loc) { }
 
     bool is_unary() const {
         return is_operator && args.size() == 1; }
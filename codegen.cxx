@@ -14,6 +14,7 @@
 
 #include <vector>
 
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
@@ -33,6 +34,55 @@ Function *get_function(const std::string& name) {
     return nullptr;
 }
 
+void emit_location(const ast_base *ast) {
+    if (!state::ll_dibuilder) {
+        return; }
+    state::ll_builder.SetCurrentDebugLocation(
+            DebugLoc::get(ast->loc.line, ast->loc.col, state::ll_discope));
+}
+
+DISubprogram *create_subprogram(Function *func, const ast_prototype& proto) {
+    DIBuilder& dib = *state::ll_dibuilder;
+    DIFile *unit = dib.createFile(state::ll_dicu->getFilename(),
+            state::ll_dicu->getDirectory());
+    DIType *double_ty = dib.createBasicType("double", 64, 64, dwarf::DW_ATE_float);
+    // return type followed by the arguments, all double.
+    SmallVector<Metadata *, 8> types(func->arg_size() + 1, double_ty);
+    DISubroutineType *func_ty = dib.createSubroutineType(unit,
+            dib.getOrCreateTypeArray(types));
+    return dib.createFunction(unit, proto.name, StringRef(), unit, proto.loc.line,
+            func_ty, false, true, proto.loc.line, DINode::FlagPrototyped, false, func);
+}
+
+std::set<std::string> transitive_callees(const std::set<std::string>& callees,
+        const std::string *self) {
+    std::set<std::string> ret(callees);
+    std::vector<std::string> pending(callees.begin(), callees.end());
+    while (!pending.empty()) {
+        std::string name = pending.back();
+        pending.pop_back();
+        auto fi = state::function_callees.find(name);
+        if ((self && name == *self) || fi == state::function_callees.end()) {
+            continue; }
+        for (auto& callee : fi->second) {
+            if (ret.insert(callee).second) {
+                pending.push_back(callee); }
+        }
+    }
+    return ret;
+}
+
+bool is_pure(const std::set<std::string>& callees, const std::string *self) {
+    for (auto& callee : callees) {
+        if (self && callee == *self) {
+            continue; }
+        auto pi = state::protos.find(callee);
+        if (pi == state::protos.end() || !pi->second->pure) {
+            return false; }
+    }
+    return true;
+}
+
 Value *ast_number::generate_code() {
     return ConstantFP::get(getGlobalContext(), APFloat(val));
 }
@@ -52,6 +102,7 @@ llvm::Value *ast_binary::generate_code() {
     if (!l || !r) {
         return nullptr; }
 
+    emit_location(this);
     switch (op) {
         case '+':
             return state::ll_builder.CreateFAdd(l, r, "addtmp");
@@ -83,13 +134,23 @@ llvm::Value *ast_call::generate_code() {
             return nullptr; }
     }
 
-    return state::ll_builder.CreateCall(callee_func, argv, "calltmp");
+    emit_location(this);
+    CallInst *call = state::ll_builder.CreateCall(callee_func, argv, "calltmp");
+    call->setCallingConv(callee_func->getCallingConv());
+    if (is_tail) {
+        call->setTailCall(); }
+    return call;
 }
 
 llvm::Function *ast_prototype::generate_code() {
     std::vector<Type *> arg_types(args.size(), Type::getDoubleTy(getGlobalContext()));
     FunctionType *ft = FunctionType::get(Type::getDoubleTy(getGlobalContext()), arg_types, false);
     Function *f = Function::Create(ft, Function::ExternalLinkage, name, state::ll_module.get());
+    f->setCallingConv(c_callable ? CallingConv::C : CallingConv::Fast);
+    if (defined) {
+        f->addFnAttr(Attribute::NoUnwind); }
+    if (pure) {
+        f->addFnAttr(Attribute::ReadNone); }
 
     size_t idx = 0;
     for (auto &arg : f->args()) {
@@ -99,6 +160,11 @@ llvm::Function *ast_prototype::generate_code() {
 
 llvm::Function *ast_function::generate_code() {
     std::string name = proto->name;
+    // a function declared extern keeps the C convention, callers
+    // compiled against the declaration depend on it.
+    auto pi = state::protos.find(name);
+    if (pi != state::protos.end() && pi->second->c_callable) {
+        proto->c_callable = true; }
     // Function *func = get_function(name);
     Function *func = get_function(proto->name);
     if (!func) {
@@ -108,13 +174,28 @@ llvm::Function *ast_function::generate_code() {
     if (!func->empty()) {
         return (Function *) error_codegen("function cannot be redefined."); }
 
+    std::set<std::string> callees;
+    body->collect_callees(callees);
+    proto->defined = true;
+    proto->pure = is_pure(callees, &name);
+    // func may be a declaration of an earlier definition or an extern.
+    func->addFnAttr(Attribute::NoUnwind);
+    if (proto->pure) {
+        func->addFnAttr(Attribute::ReadNone);
+    } else { func->removeFnAttr(Attribute::ReadNone); }
+
     BasicBlock *bb = BasicBlock::Create(getGlobalContext(), "entry", func);
     state::ll_builder.SetInsertPoint(bb);
+    if (state::ll_dibuilder) {
+        state::ll_discope = create_subprogram(func, *proto); }
     state::ll_value_map.clear();
     for (auto& arg : func->args()) {
         state::ll_value_map[arg.getName()] = &arg; }
+    body->mark_tail();
     if (Value *ret = body->generate_code()) {
         state::ll_builder.CreateRet(ret);
+        // the builder outlives this module, don't leak its locations.
+        state::ll_builder.SetCurrentDebugLocation(DebugLoc());
         verifyFunction(*func);
 
         state::ll_fpm->run(*func);
@@ -122,6 +203,7 @@ llvm::Function *ast_function::generate_code() {
 
         return func;
     }
+    state::ll_builder.SetCurrentDebugLocation(DebugLoc());
     func->eraseFromParent();
     return nullptr;
 }
@@ -130,6 +212,7 @@ llvm::Value *ast_if::generate_code() {
     Value *cond = cond_->generate_code();
     if (!cond) {
         return nullptr; }
+    emit_location(this);
     cond = state::ll_builder.CreateFCmpONE(cond,
             ConstantFP::get(getGlobalContext(), APFloat(0.0)), "ifcond");
 
@@ -165,20 +248,42 @@ llvm::Value *ast_if::generate_code() {
 }
 
 llvm::Value *ast_for::generate_code() {
+    // lowered in the canonical (rotated) form the loop passes expect:
+    //
+    //   guard:     if !end(start) goto afterloop
+    //   preheader: goto loop
+    //   loop:      var = phi [start, preheader], [next, latch]
+    //              body; next = var + step
+    //   latch:     if end(next) goto loop else goto loopexit
+    //   loopexit:  goto afterloop
     Value *start_val = start->generate_code();
-    if (start_val == 0) {
-        return 0; }
+    if (!start_val) {
+        return nullptr; }
+    emit_location(this);
     Function *func = state::ll_builder.GetInsertBlock()->getParent();
-    BasicBlock *preheader_bb = state::ll_builder.GetInsertBlock();
-    BasicBlock *loop_bb = BasicBlock::Create(getGlobalContext(), "loop", func);
 
+    Value *old_val = state::ll_value_map[var_name];
+    state::ll_value_map[var_name] = start_val;
+    Value *guard_cond = end->generate_code();
+    if (!guard_cond) {
+        return nullptr; }
+    guard_cond = state::ll_builder.CreateFCmpONE(guard_cond,
+            ConstantFP::get(getGlobalContext(), APFloat(0.0)), "guardcond");
+
+    BasicBlock *preheader_bb = BasicBlock::Create(getGlobalContext(), "preheader", func);
+    BasicBlock *loop_bb = BasicBlock::Create(getGlobalContext(), "loop");
+    BasicBlock *exit_bb = BasicBlock::Create(getGlobalContext(), "loopexit");
+    BasicBlock *after_bb = BasicBlock::Create(getGlobalContext(), "afterloop");
+    state::ll_builder.CreateCondBr(guard_cond, preheader_bb, after_bb);
+
+    state::ll_builder.SetInsertPoint(preheader_bb);
     state::ll_builder.CreateBr(loop_bb);
+
+    func->getBasicBlockList().push_back(loop_bb);
     state::ll_builder.SetInsertPoint(loop_bb);
     PHINode *var = state::ll_builder.CreatePHI(Type::getDoubleTy(getGlobalContext()),
             2, var_name.c_str());
     var->addIncoming(start_val, preheader_bb);
-
-    Value *old_val = state::ll_value_map[var_name];
     state::ll_value_map[var_name] = var;
 
     if (!body->generate_code()) {
@@ -194,17 +299,23 @@ llvm::Value *ast_for::generate_code() {
     }
 
     Value *next_var = state::ll_builder.CreateFAdd(var, step_val, "nextvar");
+    state::ll_value_map[var_name] = next_var;
     Value *end_cond = end->generate_code();
     if (!end_cond) {
         return nullptr; }
     end_cond = state::ll_builder.CreateFCmpONE(end_cond,
             ConstantFP::get(getGlobalContext(), APFloat(0.0)), "loopcond");
 
-    BasicBlock *loop_end_bb = state::ll_builder.GetInsertBlock();
-    BasicBlock *after_bb = BasicBlock::Create(getGlobalContext(), "afterloop", func);
-    state::ll_builder.CreateCondBr(end_cond, loop_bb, after_bb);
+    BasicBlock *latch_bb = state::ll_builder.GetInsertBlock();
+    state::ll_builder.CreateCondBr(end_cond, loop_bb, exit_bb);
+    var->addIncoming(next_var, latch_bb);
+
+    func->getBasicBlockList().push_back(exit_bb);
+    state::ll_builder.SetInsertPoint(exit_bb);
+    state::ll_builder.CreateBr(after_bb);
+
+    func->getBasicBlockList().push_back(after_bb);
     state::ll_builder.SetInsertPoint(after_bb);
-    var->addIncoming(next_var, loop_end_bb);
 
     if (old_val) {
         state::ll_value_map[var_name] = old_val;
@@ -10,10 +10,21 @@
 #ifndef KALEIDOSCOPE_CODEGEN_HXX
 #define KALEIDOSCOPE_CODEGEN_HXX
 
+#include <set>
+#include <string>
+
 namespace llvm {
 class Value;
 }
 
 llvm::Value *error_codegen(const char *msg);
 
+// every function reachable from callees through Kaleidoscope definitions,
+// not looking into self.
+std::set<std::string> transitive_callees(const std::set<std::string>& callees,
+        const std::string *self = nullptr);
+// calls only functions whose compiled code is pure (self aside), so
+// calling it has no side effects.
+bool is_pure(const std::set<std::string>& callees, const std::string *self = nullptr);
+
 #endif // KALEIDOSCOPE_CODEGEN_HXX
@@ -14,10 +14,18 @@
 
 typedef int TokenT;
 
+struct source_location {
+    int line;
+    int col;
+};
+
 namespace state {
 extern std::string identifier;
 extern double number;
 extern TokenT cur_token;
+// start of the current token, and the last character read.
+extern source_location cur_loc;
+extern source_location lex_loc;
 }
 
 #endif // KALEIDOSCOPE_COMMON_HXX
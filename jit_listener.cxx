@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2015 SCU ISDC All rights reserved.
+//
+// This file is part of ISDCNext.
+//
+// We have always treaded the borderland.
+//
+
+#include "jit_listener.hxx"
+
+#include <string>
+
+#include <elf.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <llvm/DebugInfo/DWARF/DWARFContext.h>
+#include <llvm/Object/SymbolSize.h>
+
+using namespace llvm;
+using namespace llvm::object;
+
+// record layout from tools/perf/util/jitdump.h in the kernel tree.
+namespace jitdump {
+
+enum {
+    MAGIC = 0x4A695444,
+    VERSION = 1,
+
+    CODE_LOAD = 0,
+    CODE_DEBUG_INFO = 2,
+};
+
+struct header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct record_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+// followed by the name (NUL terminated) and the code.
+struct code_load {
+    record_prefix prefix;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+// followed by nr_entry entries.
+struct debug_info {
+    record_prefix prefix;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+};
+
+// followed by the file name (NUL terminated).
+struct debug_entry {
+    uint64_t addr;
+    int lineno;
+    int discrim;
+};
+
+uint64_t timestamp() {
+    // must match `perf record -k mono`.
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t elf_mach() {
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__aarch64__)
+    return EM_AARCH64;
+#elif defined(__arm__)
+    return EM_ARM;
+#else
+    return EM_NONE;
+#endif
+}
+
+}
+
+perf_listener::perf_listener(bool perf_map_enabled, bool jitdump_enabled) {
+    pid_t pid = getpid();
+
+    if (perf_map_enabled) {
+        std::string path = "/tmp/perf-" + std::to_string(pid) + ".map";
+        if (!(perf_map = fopen(path.c_str(), "w"))) {
+            fprintf(stderr, "Error: cannot open %s\n", path.c_str()); }
+    }
+
+    if (jitdump_enabled) {
+        // perf inject only picks up files named jit-<pid>.dump.
+        std::string path = "/tmp/jit-" + std::to_string(pid) + ".dump";
+        if (!(jitdump = fopen(path.c_str(), "w+"))) {
+            fprintf(stderr, "Error: cannot open %s\n", path.c_str());
+            return;
+        }
+
+        // perf record finds the dump through this executable mapping.
+        jitdump_marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                MAP_PRIVATE, fileno(jitdump), 0);
+        if (jitdump_marker == MAP_FAILED) {
+            jitdump_marker = nullptr; }
+
+        jitdump::header header = { };
+        header.magic = jitdump::MAGIC;
+        header.version = jitdump::VERSION;
+        header.total_size = sizeof(header);
+        header.elf_mach = jitdump::elf_mach();
+        header.pid = pid;
+        header.timestamp = jitdump::timestamp();
+        fwrite(&header, sizeof(header), 1, jitdump);
+        fflush(jitdump);
+    }
+}
+
+perf_listener::~perf_listener() {
+    if (perf_map) {
+        fclose(perf_map); }
+    if (jitdump_marker) {
+        munmap(jitdump_marker, sysconf(_SC_PAGESIZE)); }
+    if (jitdump) {
+        fclose(jitdump); }
+}
+
+void perf_listener::NotifyObjectEmitted(const ObjectFile& obj,
+        const RuntimeDyld::LoadedObjectInfo& info) {
+    if (!perf_map && !jitdump) {
+        return; }
+
+    // a copy of the object with section addresses pointing at the loaded code.
+    OwningBinary<ObjectFile> debug_obj_owner = info.getObjectForDebug(obj);
+    const ObjectFile *debug_obj = debug_obj_owner.getBinary();
+    if (!debug_obj) {
+        return; }
+    DWARFContextInMemory context(*debug_obj);
+
+    for (const std::pair<SymbolRef, uint64_t>& p : computeSymbolSizes(*debug_obj)) {
+        const SymbolRef& sym = p.first;
+        if (sym.getType() != SymbolRef::ST_Function) {
+            continue; }
+        ErrorOr<StringRef> name = sym.getName();
+        ErrorOr<uint64_t> addr = sym.getAddress();
+        if (!name || !addr) {
+            continue; }
+        uint64_t size = p.second;
+
+        if (perf_map) {
+            fprintf(perf_map, "%lx %lx %s\n", (unsigned long) *addr,
+                    (unsigned long) size, name->str().c_str());
+            fflush(perf_map);
+        }
+        if (jitdump) {
+            // line info has to precede the code it describes.
+            write_debug_info(*addr, context.getLineInfoForAddressRange(*addr, size));
+            write_code_load(name->str().c_str(), *addr, size);
+        }
+    }
+}
+
+void perf_listener::write_code_load(const char *name, uint64_t addr, uint64_t size) {
+    size_t name_len = strlen(name) + 1;
+
+    jitdump::code_load record = { };
+    record.prefix.id = jitdump::CODE_LOAD;
+    record.prefix.total_size = sizeof(record) + name_len + size;
+    record.prefix.timestamp = jitdump::timestamp();
+    record.pid = getpid();
+    record.tid = syscall(SYS_gettid);
+    record.vma = addr;
+    record.code_addr = addr;
+    record.code_size = size;
+    record.code_index = code_index++;
+
+    fwrite(&record, sizeof(record), 1, jitdump);
+    fwrite(name, name_len, 1, jitdump);
+    fwrite((const void *) (uintptr_t) addr, size, 1, jitdump);
+    fflush(jitdump);
+}
+
+void perf_listener::write_debug_info(uint64_t addr, const DILineInfoTable& lines) {
+    if (lines.empty()) {
+        return; }
+
+    size_t total_size = sizeof(jitdump::debug_info);
+    for (const auto& line : lines) {
+        total_size += sizeof(jitdump::debug_entry) + line.second.FileName.size() + 1; }
+
+    jitdump::debug_info record = { };
+    record.prefix.id = jitdump::CODE_DEBUG_INFO;
+    record.prefix.total_size = total_size;
+    record.prefix.timestamp = jitdump::timestamp();
+    record.code_addr = addr;
+    record.nr_entry = lines.size();
+    fwrite(&record, sizeof(record), 1, jitdump);
+
+    for (const auto& line : lines) {
+        jitdump::debug_entry entry = { };
+        entry.addr = line.first;
+        entry.lineno = line.second.Line;
+        fwrite(&entry, sizeof(entry), 1, jitdump);
+        fwrite(line.second.FileName.c_str(), line.second.FileName.size() + 1, 1, jitdump);
+    }
+}
@@ -0,0 +1,39 @@
+//
+// Copyright (c) 2015 SCU ISDC All rights reserved.
+//
+// This file is part of ISDCNext.
+//
+// We have always treaded the borderland.
+//
+
+#ifndef KALEIDOSCOPE_JIT_LISTENER_HXX
+#define KALEIDOSCOPE_JIT_LISTENER_HXX
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <llvm/DebugInfo/DIContext.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+// makes JIT'd functions visible to perf, either through
+// /tmp/perf-<pid>.map (symbols only) or a jit-<pid>.dump
+// (symbols, code and line tables, for `perf inject --jit`).
+class perf_listener : public llvm::JITEventListener {
+public:
+    perf_listener(bool perf_map, bool jitdump);
+    ~perf_listener() override;
+
+    void NotifyObjectEmitted(const llvm::object::ObjectFile& obj,
+            const llvm::RuntimeDyld::LoadedObjectInfo& info) override;
+
+private:
+    void write_code_load(const char *name, uint64_t addr, uint64_t size);
+    void write_debug_info(uint64_t addr, const llvm::DILineInfoTable& lines);
+
+    FILE *perf_map = nullptr;
+    FILE *jitdump = nullptr;
+    void *jitdump_marker = nullptr;
+    uint64_t code_index = 0;
+};
+
+#endif // KALEIDOSCOPE_JIT_LISTENER_HXX
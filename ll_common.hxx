@@ -12,6 +12,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <memory>
 
 #include <llvm/IR/IRBuilder.h>
@@ -20,6 +21,9 @@ namespace llvm {
 namespace legacy {
 class FunctionPassManager;
 }
+class DIBuilder;
+class DICompileUnit;
+class DIScope;
 }
 
 class ast_prototype;
@@ -32,7 +36,15 @@ extern std::map<std::string, llvm::Value *> ll_value_map;
 extern llvm::IRBuilder<> ll_builder;
 extern std::unique_ptr<llvm::legacy::FunctionPassManager> ll_fpm;
 
+// debug info, only created when emit_debug_info is set.
+extern bool emit_debug_info;
+extern std::unique_ptr<llvm::DIBuilder> ll_dibuilder;
+extern llvm::DICompileUnit *ll_dicu;
+extern llvm::DIScope *ll_discope;
+
 extern std::map<std::string, std::unique_ptr<ast_prototype>> protos;
+// direct callees of every Kaleidoscope definition.
+extern std::map<std::string, std::set<std::string>> function_callees;
 }
 
 #endif // KALEIDOSCOPE_LL_COMMON_HXX
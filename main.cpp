@@ -5,8 +5,12 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
 
+#include <llvm/ADT/FoldingSet.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
 
@@ -17,39 +21,85 @@
 #include <llvm/Transforms/Scalar.h>
 
 #include "Kaleidoscope.hxx"
+#include "jit_listener.hxx"
 
 #include "common.hxx"
 #include "lexer.hxx"
 #include "parser.hxx"
 #include "ast.hxx"
+#include "codegen.hxx"
 
 std::map<char, int> binary_op_preced;
 
 void initialize_module_n_pass();
 
+// a compiled top-level expression, kept around while none of the
+// functions it (transitively) calls are redefined.
+struct expr_cache_entry {
+    std::set<std::string> deps;
+    // only calls Kaleidoscope functions, so the result never changes. its
+    // module is removed right away, handle and fp are only valid otherwise.
+    bool pure;
+    double result;
+    llvm::orc::KaleidoscopeJIT::ModuleHandleT handle;
+    double (*fp)();
+};
+
+struct node_id_hash {
+    size_t operator()(const llvm::FoldingSetNodeID& id) const {
+        return id.ComputeHash(); }
+};
+
+typedef std::unordered_map<llvm::FoldingSetNodeID, expr_cache_entry, node_id_hash> expr_cache_t;
+
+// every impure cached expression keeps its module in the JIT, and symbol
+// lookup walks all of them.
+const size_t expr_cache_limit = 64;
+
 namespace state {
 std::string identifier;
 double number;
 TokenT cur_token;
+source_location cur_loc;
+source_location lex_loc = { 1, 0 };
 
 std::unique_ptr<llvm::Module> ll_module;
 llvm::IRBuilder<> ll_builder(llvm::getGlobalContext());
 std::map<std::string, llvm::Value *> ll_value_map;
 std::unique_ptr<llvm::legacy::FunctionPassManager> ll_fpm;
+bool emit_debug_info = false;
+std::unique_ptr<llvm::DIBuilder> ll_dibuilder;
+llvm::DICompileUnit *ll_dicu = nullptr;
+llvm::DIScope *ll_discope = nullptr;
 std::unique_ptr<llvm::orc::KaleidoscopeJIT> ll_jit;
 std::map<std::string, std::unique_ptr<ast_prototype>> protos;
+
+// bumped on every definition, externs stay at 0.
+std::map<std::string, unsigned> function_versions;
+std::map<std::string, std::set<std::string>> function_callees;
+expr_cache_t expr_cache;
+}
+
+int advance() {
+    int chr = getchar();
+    if (chr == '\n') {
+        state::lex_loc.line++;
+        state::lex_loc.col = 0;
+    } else { state::lex_loc.col++; }
+    return chr;
 }
 
 TokenT get_token() {
     static TokenT last_chr = ' ';
 
     while (isspace(last_chr)) {
-        last_chr = getchar(); }
+        last_chr = advance(); }
+    state::cur_loc = state::lex_loc;
 
     // identifiers & keywords
     if (isalpha(last_chr)) {
         state::identifier = last_chr;
-        while (isalnum((last_chr = getchar()))) {
+        while (isalnum((last_chr = advance()))) {
             state::identifier += last_chr; }
         if (state::identifier == "def") {
             return T_DEF; }
@@ -77,7 +127,7 @@ TokenT get_token() {
         std::string str_num = "";
         do {
             str_num += last_chr;
-            last_chr = getchar();
+            last_chr = advance();
         } while (isdigit(last_chr) || last_chr == '.');
 
         state::number = strtod(str_num.c_str(), 0);
@@ -87,7 +137,7 @@ TokenT get_token() {
     // comments
     if (last_chr == '#') {
         do {
-            last_chr = getchar();
+            last_chr = advance();
         } while (last_chr != EOF && last_chr != '\n' && last_chr != '\r');
         if (last_chr != EOF)
             return get_token();
@@ -99,7 +149,7 @@ TokenT get_token() {
 
     // other characters
     TokenT this_chr = last_chr;
-    last_chr = getchar();
+    last_chr = advance();
     return this_chr;
 }
 
@@ -116,13 +166,64 @@ llvm::Value *error_codegen(const char *msg) {
     return 0;
 }
 
+void finalize_module() {
+    if (state::ll_dibuilder) {
+        state::ll_dibuilder->finalize(); }
+}
+
+unsigned function_version(const std::string& name) {
+    auto vi = state::function_versions.find(name);
+    return vi != state::function_versions.end() ? vi->second : 0;
+}
+
+expr_cache_t::iterator erase_expr_cache(expr_cache_t::iterator ci) {
+    if (!ci->second.pure) {
+        state::ll_jit->removeModule(ci->second.handle); }
+    return state::expr_cache.erase(ci);
+}
+
+// drops the cached expressions depending on name.
+void evict_expr_cache(const std::string& name) {
+    for (auto ci = state::expr_cache.begin(); ci != state::expr_cache.end(); ) {
+        if (ci->second.deps.count(name)) {
+            ci = erase_expr_cache(ci);
+        } else { ++ci; }
+    }
+}
+
+void clear_expr_cache() {
+    for (auto ci = state::expr_cache.begin(); ci != state::expr_cache.end(); ) {
+        ci = erase_expr_cache(ci); }
+}
+
 void handle_definition() {
     if (auto ast = parse_definition()) {
+        std::string name = ast->proto->name;
         if (auto ir = ast->generate_code()) {
             fprintf(stderr, "read function definition: ");
             ir->dump();
+            finalize_module();
             state::ll_jit->addModule(std::move(state::ll_module));
             initialize_module_n_pass();
+
+            state::function_versions[name]++;
+            std::set<std::string>& callees = state::function_callees[name];
+            callees.clear();
+            ast->body->collect_callees(callees);
+            // callers stay linked against the bodies they were compiled
+            // with, a redefinition can only ever make them look less pure.
+            for (bool changed = true; changed; ) {
+                changed = false;
+                for (auto& p : state::protos) {
+                    auto fi = state::function_callees.find(p.first);
+                    if (p.second->pure && fi != state::function_callees.end()
+                            && !is_pure(fi->second, &p.first)) {
+                        p.second->pure = false;
+                        changed = true;
+                    }
+                }
+            }
+            evict_expr_cache(name);
         }
     } else {
         next_token();
@@ -131,6 +232,14 @@ void handle_definition() {
 
 void handle_extern() {
     if (auto ast = parse_extern()) {
+        // redeclaring a Kaleidoscope definition, calls must keep matching
+        // its body.
+        auto pi = state::protos.find(ast->name);
+        if (pi != state::protos.end() && pi->second->defined) {
+            ast->c_callable = pi->second->c_callable;
+            ast->defined = true;
+            ast->pure = pi->second->pure;
+        }
         if (auto ir = ast->generate_code()) {
             fprintf(stderr, "read extern: ");
             ir->dump();
@@ -143,19 +252,46 @@ void handle_extern() {
 
 void handle_top_level_exp() {
     if (auto ast = parse_top_level_exp()) {
+        // the key covers the expression and the version of everything it calls.
+        std::set<std::string> callees;
+        ast->body->collect_callees(callees);
+        std::set<std::string> deps = transitive_callees(callees);
+        llvm::FoldingSetNodeID id;
+        ast->body->profile(id);
+        for (auto& dep : deps) {
+            id.AddString(dep);
+            id.AddInteger(function_version(dep));
+        }
+
+        auto ci = state::expr_cache.find(id);
+        if (ci != state::expr_cache.end()) {
+            const expr_cache_entry& entry = ci->second;
+            fprintf(stderr, "evaluated to %f (cached)\n",
+                    entry.pure ? entry.result : entry.fp());
+            return;
+        }
+
         if (auto ir = ast->generate_code()) {
             fprintf(stderr, "parsed a top-level expr.\n");
             ir->dump();
 
+            finalize_module();
             auto h = state::ll_jit->addModule(std::move(state::ll_module));
             initialize_module_n_pass();
             auto expr_symbol = state::ll_jit->findSymbol("__anon_expr");
             assert(expr_symbol && "function not found");
 
             double (*fp)() = (double (*)())(intptr_t) expr_symbol.getAddress();
-            fprintf(stderr, "evaluated to %f\n", fp());
-
-            state::ll_jit->removeModule(h);
+            double result = fp();
+            fprintf(stderr, "evaluated to %f\n", result);
+
+            if (state::expr_cache.size() >= expr_cache_limit) {
+                clear_expr_cache(); }
+            expr_cache_entry entry = { deps, is_pure(callees), result, h, fp };
+            // the result is all a pure expression needs later on.
+            if (entry.pure) {
+                state::ll_jit->removeModule(h); }
+            state::expr_cache.emplace(std::move(id), std::move(entry));
         }
     } else {
         fprintf(stderr, "failed to parse top-level expr.\n");
@@ -198,12 +334,33 @@ void initialize_module_n_pass() {
             "my cool jit", llvm::getGlobalContext());
     state::ll_module->setDataLayout(state::ll_jit->getTargetMachine().createDataLayout());
 
+    if (state::emit_debug_info) {
+        state::ll_module->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                llvm::DEBUG_METADATA_VERSION);
+        state::ll_dibuilder = llvm::make_unique<llvm::DIBuilder>(*state::ll_module);
+        // the program is read from stdin, there is no real file to point at.
+        state::ll_dicu = state::ll_dibuilder->createCompileUnit(llvm::dwarf::DW_LANG_C,
+                "<stdin>", ".", "Kaleidoscope", false, "", 0);
+    }
+
     state::ll_fpm = llvm::make_unique<llvm::legacy::FunctionPassManager>(state::ll_module.get());
+    // turn self tail recursion into loops before anything else sees it.
+    state::ll_fpm->add(llvm::createTailCallEliminationPass());
     state::ll_fpm->add(llvm::createBasicAliasAnalysisPass());
     state::ll_fpm->add(llvm::createInstructionCombiningPass());
     state::ll_fpm->add(llvm::createReassociatePass());
     state::ll_fpm->add(llvm::createGVNPass());
     state::ll_fpm->add(llvm::createCFGSimplificationPass());
+    // loop pipeline, `for` is already emitted in rotated form.
+    state::ll_fpm->add(llvm::createLoopSimplifyPass());
+    state::ll_fpm->add(llvm::createLCSSAPass());
+    state::ll_fpm->add(llvm::createLICMPass());
+    state::ll_fpm->add(llvm::createIndVarSimplifyPass());
+    state::ll_fpm->add(llvm::createLoopDeletionPass());
+    state::ll_fpm->add(llvm::createLoopUnrollPass());
+    // clean up after unrolling.
+    state::ll_fpm->add(llvm::createInstructionCombiningPass());
+    state::ll_fpm->add(llvm::createCFGSimplificationPass());
     state::ll_fpm->doInitialization();
 }
 
@@ -237,6 +394,21 @@ int main() {
     next_token();
 
     state::ll_jit = llvm::make_unique<llvm::orc::KaleidoscopeJIT>();
+
+    // opt-in profiler & debugger support, see jit_listener.hxx.
+    bool perf_map = getenv("KALEIDOSCOPE_PERF_MAP") != nullptr,
+        jitdump = getenv("KALEIDOSCOPE_JITDUMP") != nullptr,
+        gdb = getenv("KALEIDOSCOPE_GDB") != nullptr;
+    std::unique_ptr<perf_listener> perf;
+    if (perf_map || jitdump) {
+        perf = llvm::make_unique<perf_listener>(perf_map, jitdump);
+        state::ll_jit->registerJITEventListener(*perf);
+    }
+    if (gdb) {
+        state::ll_jit->registerJITEventListener(
+                *llvm::JITEventListener::createGDBRegistrationListener()); }
+    state::emit_debug_info = jitdump || gdb;
+
     initialize_module_n_pass();
 
     main_loop();
@@ -48,10 +48,14 @@ std::unique_ptr<ast_base> parse_parenthesis() {
 
 std::unique_ptr<ast_base> parse_identifier() {
     std::string name = state::identifier;
+    source_location loc = state::cur_loc;
     next_token();
 
     if (state::cur_token != '(') {
-        return llvm::make_unique<ast_var>(name); }
+        auto var = llvm::make_unique<ast_var>(name);
+        var->loc = loc;
+        return std::move(var);
+    }
     next_token();
     std::vector<std::unique_ptr<ast_base>> args;
     if (state::cur_token != ')') {
@@ -68,7 +72,9 @@ std::unique_ptr<ast_base> parse_identifier() {
     }
 
     next_token();
-    return llvm::make_unique<ast_call>(name, std::move(args));
+    auto call = llvm::make_unique<ast_call>(name, std::move(args));
+    call->loc = loc;
+    return std::move(call);
 }
 
 std::unique_ptr<ast_base> parse_primary() {
@@ -112,6 +118,7 @@ std::unique_ptr<ast_base> parse_binary_op_rhs(int preced, std::unique_ptr<ast_ba
             return lhs; }
 
         int binary_op = state::cur_token;
+        source_location loc = state::cur_loc;
         next_token();
 
         auto rhs = parse_primary();
@@ -126,10 +133,12 @@ std::unique_ptr<ast_base> parse_binary_op_rhs(int preced, std::unique_ptr<ast_ba
         }
 
         lhs = llvm::make_unique<ast_binary>(binary_op, std::move(lhs), std::move(rhs));
+        lhs->loc = loc;
     }
 }
 
 std::unique_ptr<ast_base> parse_if() {
+    source_location loc = state::cur_loc;
     next_token();
 
     auto cond_ = parse_expression();
@@ -151,11 +160,14 @@ std::unique_ptr<ast_base> parse_if() {
     if (!else_) {
         return nullptr; }
 
-    return llvm::make_unique<ast_if>(std::move(cond_),
+    auto ret = llvm::make_unique<ast_if>(std::move(cond_),
             std::move(then_), std::move(else_));
+    ret->loc = loc;
+    return std::move(ret);
 }
 
 std::unique_ptr<ast_base> parse_for() {
+    source_location loc = state::cur_loc;
     next_token();
 
     if (state::cur_token != T_ID) {
@@ -195,14 +207,17 @@ std::unique_ptr<ast_base> parse_for() {
     if (!body) {
         return nullptr; }
 
-    return llvm::make_unique<ast_for>(id_name, std::move(start), std::move(end),
+    auto ret = llvm::make_unique<ast_for>(id_name, std::move(start), std::move(end),
         std::move(step), std::move(body));
+    ret->loc = loc;
+    return std::move(ret);
 }
 
 std::unique_ptr<ast_prototype> parse_prototype() {
     if (state::cur_token != T_ID) {
         return error_p("expect function name in prototype."); }
     std::string function_name;
+    source_location loc = state::cur_loc;
     OperatorType type = IDENTIFIER;
     size_t precedence = 30;
 
@@ -241,7 +256,9 @@ std::unique_ptr<ast_prototype> parse_prototype() {
         return error_p("expected ')' in prototype."); }
 
     next_token();
-    return llvm::make_unique<ast_prototype>(function_name, std::move(arg_names));
+    auto proto = llvm::make_unique<ast_prototype>(function_name, std::move(arg_names));
+    proto->loc = loc;
+    return proto;
 }
 
 std::unique_ptr<ast_function> parse_definition() {
@@ -256,12 +273,18 @@ std::unique_ptr<ast_function> parse_definition() {
 
 std::unique_ptr<ast_prototype> parse_extern() {
     next_token();
-    return parse_prototype();
+    auto proto = parse_prototype();
+    if (proto) {
+        proto->c_callable = true; }
+    return proto;
 }
 
 std::unique_ptr<ast_function> parse_top_level_exp() {
+    source_location loc = state::cur_loc;
     if (auto e = parse_expression()) {
         auto proto = llvm::make_unique<ast_prototype>("__anon_expr", std::vector<std::string>());
+        proto->c_callable = true;
+        proto->loc = loc;
         return llvm::make_unique<ast_function>(std::move(proto), std::move(e));
     }
     return nullptr;